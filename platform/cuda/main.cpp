@@ -22,24 +22,152 @@
 
 #include <common/common.h>
 #include <common/sample_controls.h>
+#include <core/TellusimTime.h>
+#include <core/TellusimFile.h>
 #include <math/TellusimMath.h>
 #include <platform/TellusimDevice.h>
 #include <platform/TellusimContext.h>
 #include <platform/TellusimPipeline.h>
 #include <platform/TellusimCommand.h>
 
+#include <algorithm>
+
 #include "include/TellusimCU.h"
 
 /*
  */
 using namespace Tellusim;
 
+/*
+ */
+class FrameProfiler {
+	
+	public:
+		
+		// frame phases
+		enum Phase {
+			PhaseFrame = 0,
+			PhaseUpdate,
+			PhaseControls,
+			PhaseCanvas,
+			PhaseKernel,
+			PhaseCommand,
+			PhasePresent,
+			PhaseCheck,
+			NumPhases,
+		};
+		
+		// history size
+		enum {
+			NumFrames = 256,
+		};
+		
+		FrameProfiler() : start_time(Time::seconds()) { }
+		
+		// phase markers
+		void begin(Phase phase) {
+			if(phase == PhaseFrame) {
+				for(uint32_t i = 0; i < NumPhases; i++) {
+					begin_times[frame][i] = 0.0;
+					durations[frame][i] = 0.0f;
+				}
+			}
+			begin_times[frame][phase] = Time::seconds() - start_time;
+		}
+		void end(Phase phase) {
+			durations[frame][phase] = (float32_t)(Time::seconds() - start_time - begin_times[frame][phase]);
+			if(phase == PhaseFrame) {
+				frame = (frame + 1) % NumFrames;
+				if(num_frames < NumFrames) num_frames++;
+			}
+		}
+		
+		// resolved GPU time of the phase in milliseconds
+		void setGPUTime(Phase phase, float32_t time) {
+			gpu_times[phase] = time;
+		}
+		
+		// phase names
+		static const char *getName(Phase phase) {
+			static const char *names[NumPhases] = { "Frame", "Update", "Controls", "Canvas", "Kernel", "Command", "Present", "Check" };
+			return names[phase];
+		}
+		
+		// phase statistics in milliseconds
+		float32_t getAverage(Phase phase) const {
+			if(num_frames == 0) return 0.0f;
+			float32_t sum = 0.0f;
+			for(uint32_t i = 0; i < num_frames; i++) sum += durations[i][phase];
+			return sum * 1000.0f / num_frames;
+		}
+		float32_t getPercentile(Phase phase, float32_t percentile) const {
+			if(num_frames == 0) return 0.0f;
+			float32_t values[NumFrames];
+			for(uint32_t i = 0; i < num_frames; i++) values[i] = durations[i][phase];
+			uint32_t index = min((uint32_t)(percentile * num_frames), num_frames - 1);
+			std::nth_element(values, values + index, values + num_frames);
+			return values[index] * 1000.0f;
+		}
+		
+		// text report
+		String getReport() const {
+			String ret = String::format("%s p50 %.2f p95 %.2f p99 %.2f ms", getName(PhaseFrame), getPercentile(PhaseFrame, 0.5f), getPercentile(PhaseFrame, 0.95f), getPercentile(PhaseFrame, 0.99f));
+			for(uint32_t i = PhaseFrame + 1; i < NumPhases; i++) {
+				ret += String::format("\n%s avg %.2f p99 %.2f ms", getName((Phase)i), getAverage((Phase)i), getPercentile((Phase)i, 0.99f));
+				if(gpu_times[i] > 0.0f) ret += String::format(" GPU %.2f ms", gpu_times[i]);
+			}
+			return ret;
+		}
+		
+		// Chrome trace export
+		bool saveTrace(const char *name) const {
+			String data = "{\"traceEvents\":[";
+			uint32_t first = (frame + NumFrames - num_frames) % NumFrames;
+			for(uint32_t i = 0; i < num_frames; i++) {
+				uint32_t index = (first + i) % NumFrames;
+				for(uint32_t j = 0; j < NumPhases; j++) {
+					if(i || j) data += ",";
+					data += String::format("\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":%.1f,\"dur\":%.1f}", getName((Phase)j), begin_times[index][j] * 1e6, durations[index][j] * 1e6);
+				}
+			}
+			data += "\n]}\n";
+			File file;
+			if(!file.open(name, "wb")) return false;
+			return (file.write(data.get(), data.size()) == data.size());
+		}
+	
+	private:
+		
+		float64_t start_time = 0.0;
+		uint32_t frame = 0;
+		uint32_t num_frames = 0;
+		float64_t begin_times[NumFrames][NumPhases] = {};
+		float32_t durations[NumFrames][NumPhases] = {};
+		float32_t gpu_times[NumPhases] = {};
+};
+
 /*
  */
 int32_t main(int32_t argc, char **argv) {
 	
 	DECLARE_WINDOW
 	
+	// profiler arguments
+	const char *trace_name = nullptr;
+	bool profiler_overlay = false;
+	for(int32_t i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "-trace")) {
+			if(i + 1 == argc) {
+				TS_LOG(Error, "main(): -trace requires a file name\n");
+				return 1;
+			}
+			trace_name = argv[++i];
+		}
+		else if(!strcmp(argv[i], "-overlay")) {
+			profiler_overlay = true;
+		}
+	}
+	
 	// create window
 	String title = String::format("%s Tellusim::Cuda", window.getPlatformName());
 	if(!window.create(title) || !window.setHidden(false)) return 1;
@@ -109,6 +237,20 @@ int32_t main(int32_t argc, char **argv) {
 	CUBuffer cu_uniform_buffer = CUBuffer(cu_device.createBuffer(Buffer::FlagStorage, sizeof(ComputeParameters)));
 	if(!cu_uniform_buffer) return 1;
 	
+	// create Cuda timestamp events
+	// the stream is synchronized every frame so a single pair is complete when it is read
+	CUevent cu_events[2] = {};
+	if(CUContext::error(Tellusim::cuCtxSetCurrent(cu_context.getCUContext()))) {
+		TS_LOG(Error, "main(): can't set current context\n");
+		return 1;
+	}
+	for(uint32_t i = 0; i < TS_COUNTOF(cu_events); i++) {
+		if(CUContext::error(Tellusim::cuEventCreate(&cu_events[i], CU_EVENT_DEFAULT))) {
+			TS_LOG(Error, "main(): can't create event\n");
+			return 1;
+		}
+	}
+	
 	// create target
 	Target target = device.createTarget(window);
 	
@@ -125,23 +267,49 @@ int32_t main(int32_t argc, char **argv) {
 	ControlSlider scale_slider(&panel, "Scale", 3, 32.0f, 16.0f, 48.0f);
 	scale_slider.setSize(192.0f, 0.0f);
 	
+	// create profiler text
+	// the overlay is attached to the panel only with the -overlay argument
+	ControlText profiler_text((profiler_overlay) ? &panel : nullptr, "");
+	profiler_text.setAlign(Control::AlignLeft);
+	
+	// frame profiler
+	FrameProfiler profiler;
+	float64_t report_time = 0.0;
+	
 	// main loop
 	DECLARE_GLOBAL
 	window.run([&]() -> bool {
 		DECLARE_COMMON
 		
+		profiler.begin(FrameProfiler::PhaseFrame);
+		
+		profiler.begin(FrameProfiler::PhaseUpdate);
 		Window::update();
+		profiler.end(FrameProfiler::PhaseUpdate);
 		
 		if(!window.render()) return false;
 		
 		// window title
 		if(fps > 0.0f) window.setTitle(String::format("%s %.1f FPS", title.get(), fps));
 		
+		// profiler report
+		if(profiler_overlay && Time::seconds() - report_time > 0.5) {
+			profiler_text.setText(profiler.getReport());
+			report_time = Time::seconds();
+		}
+		
 		// update controls
+		profiler.begin(FrameProfiler::PhaseControls);
 		update_controls(window, root);
+		profiler.end(FrameProfiler::PhaseControls);
+		
+		// create canvas
+		profiler.begin(FrameProfiler::PhaseCanvas);
 		canvas.create(device, target);
+		profiler.end(FrameProfiler::PhaseCanvas);
 		
 		// dispatch Cuda kernel
+		profiler.begin(FrameProfiler::PhaseKernel);
 		{
 			// set current context
 			if(CUContext::error(Tellusim::cuCtxSetCurrent(cu_context.getCUContext()))) {
@@ -175,22 +343,38 @@ int32_t main(int32_t argc, char **argv) {
 			
 			// launch kernel
 			uint32_t num_groups = udiv(grid_size, group_size);
+			if(CUContext::error(Tellusim::cuEventRecord(cu_events[0], cu_context.getStream()))) {
+				TS_LOG(Error, "main(): can't record event\n");
+				return false;
+			}
 			if(CUContext::error(Tellusim::cuLaunchKernel(cu_shader.getFunction(), num_groups, num_groups, 1, group_size, group_size, 1, 0, cu_context.getStream(), nullptr, options))) {
 				TS_LOG(Error, "main(): can't launch kernel\n");
 				return false;
 			}
+			if(CUContext::error(Tellusim::cuEventRecord(cu_events[1], cu_context.getStream()))) {
+				TS_LOG(Error, "main(): can't record event\n");
+				return false;
+			}
 			
 			// synchronize stream
 			if(CUContext::error(Tellusim::cuStreamSynchronize(cu_context.getStream()))) {
 				TS_LOG(Error, "main(): can't synchronize stream\n");
 				return false;
 			}
+			
+			// kernel time
+			float32_t gpu_time = 0.0f;
+			if(!CUContext::error(Tellusim::cuEventElapsedTime(&gpu_time, cu_events[0], cu_events[1]))) {
+				profiler.setGPUTime(FrameProfiler::PhaseKernel, gpu_time);
+			}
 		}
+		profiler.end(FrameProfiler::PhaseKernel);
 		
 		// flush buffer
 		device.flushBuffer(position_buffer);
 		
 		// window target
+		profiler.begin(FrameProfiler::PhaseCommand);
 		target.setClearColor(0.2f, 0.2f, 0.2f, 1.0f);
 		target.begin();
 		{
@@ -217,10 +401,17 @@ int32_t main(int32_t argc, char **argv) {
 			canvas.draw(command, target);
 		}
 		target.end();
+		profiler.end(FrameProfiler::PhaseCommand);
 		
+		profiler.begin(FrameProfiler::PhasePresent);
 		if(!window.present()) return false;
+		profiler.end(FrameProfiler::PhasePresent);
 		
+		profiler.begin(FrameProfiler::PhaseCheck);
 		if(!device.check()) return false;
+		profiler.end(FrameProfiler::PhaseCheck);
+		
+		profiler.end(FrameProfiler::PhaseFrame);
 		
 		return true;
 	});
@@ -228,5 +419,17 @@ int32_t main(int32_t argc, char **argv) {
 	// finish context
 	window.finish();
 	
+	// destroy Cuda timestamp events
+	if(!CUContext::error(Tellusim::cuCtxSetCurrent(cu_context.getCUContext()))) {
+		for(uint32_t i = 0; i < TS_COUNTOF(cu_events); i++) {
+			Tellusim::cuEventDestroy(cu_events[i]);
+		}
+	}
+	
+	// save profiler trace
+	if(trace_name && !profiler.saveTrace(trace_name)) {
+		TS_LOGF(Error, "main(): can't save trace \"%s\"\n", trace_name);
+	}
+	
 	return 0;
 }
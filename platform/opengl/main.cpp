@@ -21,6 +21,7 @@
 // SOFTWARE.
 
 #include <common/common.h>
+#include <core/TellusimFile.h>
 #include <format/TellusimMesh.h>
 #include <platform/TellusimDevice.h>
 #include <platform/TellusimCommand.h>
@@ -54,10 +55,14 @@ int32_t main(int32_t argc, char **argv) {
 	struct CommonParameters {
 		Matrix4x4f projection;
 		Matrix4x4f modelview;
-		Matrix4x4f transform;
 		Vector4f camera;
 	};
 	
+	// instance parameters
+	constexpr uint32_t grid_size = 16;
+	constexpr uint32_t num_instances = grid_size * grid_size;
+	constexpr float32_t grid_step = 3.0f;
+	
 	// initialize OpenGL
 	if(!GL::init()) {
 		TS_LOG(Error, "main(): can't init OpenGL\n");
@@ -71,6 +76,7 @@ int32_t main(int32_t argc, char **argv) {
 	// create pipeline
 	Pipeline pipeline = device.createPipeline();
 	pipeline.setUniformMask(0, Shader::MaskVertex);
+	pipeline.setStorageMask(0, Shader::MaskVertex);
 	pipeline.addAttribute(Pipeline::AttributePosition, FormatRGBf32, 0, offsetof(Vertex, position), sizeof(Vertex));
 	pipeline.addAttribute(Pipeline::AttributeNormal, FormatRGBf32, 0, offsetof(Vertex, normal), sizeof(Vertex));
 	pipeline.setColorFormat(window.getColorFormat());
@@ -88,9 +94,110 @@ int32_t main(int32_t argc, char **argv) {
 	MeshModel model;
 	if(!model.create(device, pipeline, mesh)) return 1;
 	
+	// create instance transforms
+	Array<Matrix4x3f> transforms(num_instances);
+	
 	// create target
 	Target target = device.createTarget(window);
 	
+	// create timestamp queries
+	constexpr uint32_t num_queries = 4;
+	GLuint queries[num_queries * 2];
+	glGenQueries(num_queries * 2, queries);
+	bool query_written[num_queries] = {};
+	uint32_t query_frame = 0;
+	float32_t gpu_time = 0.0f;
+	
+	// framebuffer readback
+	constexpr uint32_t num_readbacks = 3;
+	struct Readback {
+		GLuint buffer = 0;
+		GLsync fence = nullptr;
+		size_t size = 0;
+		uint32_t width = 0;
+		uint32_t height = 0;
+	};
+	Readback readbacks[num_readbacks];
+	uint32_t readback_frame = 0;
+	
+	// multisample resolve
+	GLint sample_buffers = -1;
+	GLenum resolve_format = GL_NONE;
+	GLuint resolve_framebuffer = 0;
+	GLuint resolve_renderbuffer = 0;
+	uint32_t resolve_width = 0;
+	uint32_t resolve_height = 0;
+	
+	// capture file
+	File capture_file;
+	bool capture = false;
+	for(int32_t i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "-capture")) continue;
+		if(i + 1 == argc) {
+			TS_LOG(Error, "main(): -capture requires a file name\n");
+			return 1;
+		}
+		if(!capture_file.open(argv[++i], "wb")) {
+			TS_LOGF(Error, "main(): can't open \"%s\" file\n", argv[i]);
+			return 1;
+		}
+		capture = true;
+	}
+	
+	// readback callback
+	// data points directly to the mapped buffer and is valid only during the call
+	// each frame is stored as uint32_t width and height followed by RGBA8 pixels with bottom-up rows
+	bool capture_error = false;
+	auto readback_callback = [&](const void *data, uint32_t width, uint32_t height) {
+		uint32_t header[2] = { width, height };
+		size_t size = (size_t)width * height * 4;
+		if(capture_file.write(header, sizeof(header)) != sizeof(header) || capture_file.write(data, size) != size) {
+			TS_LOG(Error, "main(): can't write capture frame\n");
+			capture_error = true;
+		}
+	};
+	
+	// resolve format must match the window color format because multisample blits can't convert formats
+	// only normalized formats are supported because pixels are read as RGBA8
+	auto get_color_format = [&]() -> GLenum {
+		GLint red = 0, green = 0, blue = 0, alpha = 0, type = 0, encoding = 0;
+		glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, GL_BACK_LEFT, GL_FRAMEBUFFER_ATTACHMENT_RED_SIZE, &red);
+		glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, GL_BACK_LEFT, GL_FRAMEBUFFER_ATTACHMENT_GREEN_SIZE, &green);
+		glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, GL_BACK_LEFT, GL_FRAMEBUFFER_ATTACHMENT_BLUE_SIZE, &blue);
+		glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, GL_BACK_LEFT, GL_FRAMEBUFFER_ATTACHMENT_ALPHA_SIZE, &alpha);
+		glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, GL_BACK_LEFT, GL_FRAMEBUFFER_ATTACHMENT_COMPONENT_TYPE, &type);
+		glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, GL_BACK_LEFT, GL_FRAMEBUFFER_ATTACHMENT_COLOR_ENCODING, &encoding);
+		if(type != GL_UNSIGNED_NORMALIZED) return GL_NONE;
+		if(red == 8 && green == 8 && blue == 8) {
+			if(encoding == GL_SRGB) return (alpha) ? GL_SRGB8_ALPHA8 : GL_SRGB8;
+			return (alpha) ? GL_RGBA8 : GL_RGB8;
+		}
+		if(red == 10 && green == 10 && blue == 10 && alpha == 2) return GL_RGB10_A2;
+		if(red == 5 && green == 6 && blue == 5 && alpha == 0) return GL_RGB565;
+		return GL_NONE;
+	};
+	
+	// complete readback if its fence is signaled within the timeout
+	auto complete_readback = [&](Readback &readback, GLuint64 timeout) -> bool {
+		if(!readback.fence) return true;
+		GLenum status = glClientWaitSync(readback.fence, (timeout) ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, timeout);
+		if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return false;
+		glDeleteSync(readback.fence);
+		readback.fence = nullptr;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+		const void *data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, readback.size, GL_MAP_READ_BIT);
+		if(data) {
+			readback_callback(data, readback.width, readback.height);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		else {
+			TS_LOG(Error, "main(): can't map readback buffer\n");
+			capture_error = true;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		return true;
+	};
+	
 	// main loop
 	DECLARE_GLOBAL
 	window.run([&]() -> bool {
@@ -101,7 +208,22 @@ int32_t main(int32_t argc, char **argv) {
 		if(!window.render()) return false;
 		
 		// window title
-		if(fps > 0.0f) window.setTitle(String::format("%s %.1f FPS", title.get(), fps));
+		if(fps > 0.0f) window.setTitle(String::format("%s %.1f FPS Model GPU %.2f ms", title.get(), fps, gpu_time));
+		
+		// resolve timestamp queries from the oldest frame without waiting
+		uint32_t query_slot = query_frame++ % num_queries;
+		GLuint *query = queries + query_slot * 2;
+		if(query_written[query_slot]) {
+			GLint available = GL_FALSE;
+			glGetQueryObjectiv(query[1], GL_QUERY_RESULT_AVAILABLE, &available);
+			if(available) {
+				GLuint64 timestamps[2];
+				glGetQueryObjectui64v(query[0], GL_QUERY_RESULT, &timestamps[0]);
+				glGetQueryObjectui64v(query[1], GL_QUERY_RESULT, &timestamps[1]);
+				gpu_time = (float32_t)((timestamps[1] - timestamps[0]) * 1.0e-6);
+			}
+			query_written[query_slot] = false;
+		}
 		
 		// window target
 		target.setClearColor(Color("#5586a4"));
@@ -118,23 +240,115 @@ int32_t main(int32_t argc, char **argv) {
 			
 			// set common parameters
 			CommonParameters common_parameters;
-			common_parameters.camera = Vector4f(3.0f, 3.0f, 2.0f, 0.0f);
+			common_parameters.camera = Vector4f(3.0f, 3.0f, 2.0f, 0.0f) * (1.0f + (grid_size - 1) * grid_step * 0.5f);
 			common_parameters.projection = Matrix4x4f::perspective(60.0f, (float32_t)window.getWidth() / window.getHeight(), 0.1f, 1000.0f);
 			common_parameters.modelview = Matrix4x4f::lookAt(Vector3f(common_parameters.camera), Vector3f(0.0f, 0.0f, 0.0f), Vector3f(0.0f, 0.0f, 1.0f));
-			common_parameters.transform = Matrix4x4f::rotateX(time * 16.0f) * Matrix4x4f::rotateY(time * 24.0f) * Matrix4x4f::rotateZ(time * 32.0f);
 			if(target.isFlipped()) common_parameters.projection = Matrix4x4f::scale(1.0f, -1.0f, 1.0f) * common_parameters.projection;
 			command.setUniform(0, common_parameters);
 			
+			// set instance transforms
+			for(uint32_t y = 0, i = 0; y < grid_size; y++) {
+				for(uint32_t x = 0; x < grid_size; x++, i++) {
+					Vector3f offset = Vector3f(x - (grid_size - 1) * 0.5f, y - (grid_size - 1) * 0.5f, 0.0f) * grid_step;
+					float32_t angle = time + i * 0.1f;
+					transforms[i] = Matrix4x3f(Matrix4x4f::translate(offset) * Matrix4x4f::rotateX(angle * 16.0f) * Matrix4x4f::rotateY(angle * 24.0f) * Matrix4x4f::rotateZ(angle * 32.0f));
+				}
+			}
+			command.setStorageData(0, transforms.get(), sizeof(Matrix4x3f) * transforms.size());
+			
+			// begin timestamp
+			glQueryCounter(query[0], GL_TIMESTAMP);
+			
 			// draw model with OpenGL API
 			for(uint32_t i = 0; i < model.getNumGeometries(); i++) {
 				uint32_t num_indices = model.getNumGeometryIndices(i);
 				uint32_t base_index = model.getGeometryBaseIndex(i);
 				uint32_t base_vertex = model.getGeometryBaseVertex(i);
-				glDrawElementsBaseVertex(GL_TRIANGLES, num_indices, GL_UNSIGNED_SHORT, (const void*)(size_t)(base_index << 2), base_vertex);
+				glDrawElementsInstancedBaseVertex(GL_TRIANGLES, num_indices, GL_UNSIGNED_SHORT, (const void*)(size_t)(base_index << 2), num_instances, base_vertex);
 			}
+			
+			// end timestamp
+			glQueryCounter(query[1], GL_TIMESTAMP);
+			query_written[query_slot] = true;
 		}
 		target.end();
 		
+		// pipelined framebuffer readback
+		if(capture) {
+			// complete finished readbacks in submission order
+			for(uint32_t i = 0; i < num_readbacks; i++) {
+				if(!complete_readback(readbacks[(readback_frame + i) % num_readbacks], 0)) break;
+			}
+			if(capture_error) return false;
+			
+			// the oldest readback must be complete before its buffer is reused
+			Readback &readback = readbacks[readback_frame++ % num_readbacks];
+			if(!complete_readback(readback, 1000000000ull)) {
+				TS_LOG(Error, "main(): can't complete readback\n");
+				capture_error = true;
+				return false;
+			}
+			if(capture_error) return false;
+			
+			// resize readback buffer
+			readback.width = target.getWidth();
+			readback.height = target.getHeight();
+			size_t size = (size_t)readback.width * readback.height * 4;
+			if(!readback.buffer) glGenBuffers(1, &readback.buffer);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+			if(readback.size != size) {
+				glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+				readback.size = size;
+			}
+			
+			// copy window framebuffer into the buffer without waiting
+			GLint read_framebuffer = 0;
+			GLint draw_framebuffer = 0;
+			glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_framebuffer);
+			glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_framebuffer);
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			if(sample_buffers < 0) {
+				glGetIntegerv(GL_SAMPLE_BUFFERS, &sample_buffers);
+				resolve_format = get_color_format();
+				if(resolve_format == GL_NONE) {
+					TS_LOG(Error, "main(): unsupported window color format\n");
+					capture_error = true;
+					return false;
+				}
+			}
+			
+			// multisampled window framebuffer can't be read directly and is resolved first
+			if(sample_buffers > 0) {
+				if(!resolve_framebuffer) {
+					glGenFramebuffers(1, &resolve_framebuffer);
+					glGenRenderbuffers(1, &resolve_renderbuffer);
+				}
+				glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolve_framebuffer);
+				if(resolve_width != readback.width || resolve_height != readback.height) {
+					glBindRenderbuffer(GL_RENDERBUFFER, resolve_renderbuffer);
+					glRenderbufferStorage(GL_RENDERBUFFER, resolve_format, readback.width, readback.height);
+					glBindRenderbuffer(GL_RENDERBUFFER, 0);
+					glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, resolve_renderbuffer);
+					if(glGetError() != GL_NO_ERROR || glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+						TS_LOG(Error, "main(): can't create resolve framebuffer\n");
+						capture_error = true;
+						return false;
+					}
+					resolve_width = readback.width;
+					resolve_height = readback.height;
+				}
+				glBlitFramebuffer(0, 0, readback.width, readback.height, 0, 0, readback.width, readback.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+				glBindFramebuffer(GL_READ_FRAMEBUFFER, resolve_framebuffer);
+			}
+			glReadPixels(0, 0, readback.width, readback.height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			
+			// restore bindings
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, read_framebuffer);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw_framebuffer);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+		
 		if(!window.present()) return false;
 		
 		if(!device.check()) return false;
@@ -142,8 +356,27 @@ int32_t main(int32_t argc, char **argv) {
 		return true;
 	});
 	
+	// complete pending readbacks
+	for(uint32_t i = 0; i < num_readbacks; i++) {
+		Readback &readback = readbacks[(readback_frame + i) % num_readbacks];
+		if(!capture_error && !complete_readback(readback, 1000000000ull)) {
+			TS_LOG(Error, "main(): can't complete readback\n");
+			capture_error = true;
+		}
+		if(readback.fence) glDeleteSync(readback.fence);
+		if(readback.buffer) glDeleteBuffers(1, &readback.buffer);
+	}
+	if(resolve_framebuffer) glDeleteFramebuffers(1, &resolve_framebuffer);
+	if(resolve_renderbuffer) glDeleteRenderbuffers(1, &resolve_renderbuffer);
+	
+	// delete timestamp queries
+	glDeleteQueries(num_queries * 2, queries);
+	
 	// finish context
 	window.finish();
 	
+	// report failed capture
+	if(capture_error) return 1;
+	
 	return 0;
 }
@@ -32,10 +32,11 @@
 	layout(row_major, binding = 0) uniform CommonParameters {
 		mat4 projection;
 		mat4 modelview;
-		mat4 transform;
 		vec4 camera;
 	};
 	
+	layout(std430, binding = 1) readonly buffer TransformBuffer { vec4 transform_buffer[]; };
+	
 	layout(location = 0) out vec3 s_direction;
 	layout(location = 1) out vec3 s_normal;
 	
@@ -43,11 +44,16 @@
 	 */
 	void main() {
 		
-		vec4 position = transform * in_position;
+		uint index = uint(gl_InstanceID) * 3u;
+		vec4 row_0 = transform_buffer[index + 0u];
+		vec4 row_1 = transform_buffer[index + 1u];
+		vec4 row_2 = transform_buffer[index + 2u];
+		
+		vec4 position = vec4(dot(row_0, in_position), dot(row_1, in_position), dot(row_2, in_position), 1.0f);
 		gl_Position = projection * (modelview * position);
 		
 		s_direction = camera.xyz - position.xyz;
-		s_normal = (transform * vec4(in_normal, 0.0f)).xyz;
+		s_normal = vec3(dot(row_0.xyz, in_normal), dot(row_1.xyz, in_normal), dot(row_2.xyz, in_normal));
 	}
 	
 #elif FRAGMENT_SHADER
@@ -54,10 +54,14 @@ int32_t main(int32_t argc, char **argv) {
 	struct CommonParameters {
 		Matrix4x4f projection;
 		Matrix4x4f modelview;
-		Matrix4x4f transform;
 		Vector4f camera;
 	};
 	
+	// instance parameters
+	constexpr uint32_t grid_size = 16;
+	constexpr uint32_t num_instances = grid_size * grid_size;
+	constexpr float32_t grid_step = 3.0f;
+	
 	// initialize Vulkan
 	if(!VK::init()) {
 		TS_LOG(Error, "main(): can't init Vulkan\n");
@@ -71,6 +75,7 @@ int32_t main(int32_t argc, char **argv) {
 	// create pipeline
 	Pipeline pipeline = device.createPipeline();
 	pipeline.setUniformMask(0, Shader::MaskVertex);
+	pipeline.setStorageMask(0, Shader::MaskVertex);
 	pipeline.addAttribute(Pipeline::AttributePosition, FormatRGBf32, 0, offsetof(Vertex, position), sizeof(Vertex));
 	pipeline.addAttribute(Pipeline::AttributeNormal, FormatRGBf32, 0, offsetof(Vertex, normal), sizeof(Vertex));
 	pipeline.setColorFormat(window.getColorFormat());
@@ -88,9 +93,47 @@ int32_t main(int32_t argc, char **argv) {
 	MeshModel model;
 	if(!model.create(device, pipeline, mesh)) return 1;
 	
+	// create instance transforms
+	Array<Matrix4x3f> transforms(num_instances);
+	
 	// create target
 	Target target = device.createTarget(window);
 	
+	// create timestamp queries
+	constexpr uint32_t num_queries = 4;
+	VKDevice vk_device = VKDevice(device);
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(vk_device.getVKPhysicalDevice(), &properties);
+	
+	// valid timestamp bits of the graphics queue
+	uint32_t num_families = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(vk_device.getVKPhysicalDevice(), &num_families, nullptr);
+	Array<VkQueueFamilyProperties> families(num_families);
+	vkGetPhysicalDeviceQueueFamilyProperties(vk_device.getVKPhysicalDevice(), &num_families, families.get());
+	uint32_t timestamp_bits = 0;
+	for(uint32_t i = 0; i < num_families; i++) {
+		if(families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+			timestamp_bits = families[i].timestampValidBits;
+			break;
+		}
+	}
+	uint64_t timestamp_mask = (timestamp_bits < 64) ? ((1ull << timestamp_bits) - 1) : ~0ull;
+	
+	VkQueryPool query_pool = VK_NULL_HANDLE;
+	if(properties.limits.timestampComputeAndGraphics && timestamp_bits) {
+		VkQueryPoolCreateInfo query_info = {};
+		query_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		query_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		query_info.queryCount = num_queries * 2;
+		if(vkCreateQueryPool(vk_device.getVKDevice(), &query_info, nullptr, &query_pool) != VK_SUCCESS) {
+			TS_LOG(Error, "main(): can't create query pool\n");
+			return 1;
+		}
+	}
+	bool query_written[num_queries] = {};
+	uint32_t query_frame = 0;
+	float32_t gpu_time = 0.0f;
+	
 	// main loop
 	DECLARE_GLOBAL
 	window.run([&]() -> bool {
@@ -101,7 +144,24 @@ int32_t main(int32_t argc, char **argv) {
 		if(!window.render()) return false;
 		
 		// window title
-		if(fps > 0.0f) window.setTitle(String::format("%s %.1f FPS", title.get(), fps));
+		if(fps > 0.0f) window.setTitle(String::format("%s %.1f FPS Model GPU %.2f ms", title.get(), fps, gpu_time));
+		
+		// resolve timestamp queries from the oldest frame without waiting
+		uint32_t query_slot = query_frame++ % num_queries;
+		uint32_t query_index = query_slot * 2;
+		if(query_pool && query_written[query_slot]) {
+			uint64_t timestamps[2] = {};
+			if(vkGetQueryPoolResults(vk_device.getVKDevice(), query_pool, query_index, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+				gpu_time = (float32_t)(((timestamps[1] - timestamps[0]) & timestamp_mask) * properties.limits.timestampPeriod * 1.0e-6);
+			}
+			query_written[query_slot] = false;
+		}
+		
+		// queries must be reset outside of the render pass
+		if(query_pool) {
+			VKCompute compute = VKCompute(device.createCompute());
+			vkCmdResetQueryPool(compute.getVKCommand(), query_pool, query_index, 2);
+		}
 		
 		// window target
 		target.setClearColor(Color("#ac162c"));
@@ -122,22 +182,40 @@ int32_t main(int32_t argc, char **argv) {
 			
 			// set common parameters
 			CommonParameters common_parameters;
-			common_parameters.camera = Vector4f(3.0f, 3.0f, 2.0f, 0.0f);
+			common_parameters.camera = Vector4f(3.0f, 3.0f, 2.0f, 0.0f) * (1.0f + (grid_size - 1) * grid_step * 0.5f);
 			common_parameters.projection = Matrix4x4f::perspective(60.0f, (float32_t)window.getWidth() / window.getHeight(), 0.1f, 1000.0f);
 			common_parameters.modelview = Matrix4x4f::lookAt(Vector3f(common_parameters.camera), Vector3f(0.0f, 0.0f, 0.0f), Vector3f(0.0f, 0.0f, 1.0f));
-			common_parameters.transform = Matrix4x4f::rotateX(time * 16.0f) * Matrix4x4f::rotateY(time * 24.0f) * Matrix4x4f::rotateZ(time * 32.0f);
 			if(target.isFlipped()) common_parameters.projection = Matrix4x4f::scale(1.0f, -1.0f, 1.0f) * common_parameters.projection;
 			command.setUniform(0, common_parameters);
 			
+			// set instance transforms
+			for(uint32_t y = 0, i = 0; y < grid_size; y++) {
+				for(uint32_t x = 0; x < grid_size; x++, i++) {
+					Vector3f offset = Vector3f(x - (grid_size - 1) * 0.5f, y - (grid_size - 1) * 0.5f, 0.0f) * grid_step;
+					float32_t angle = time + i * 0.1f;
+					transforms[i] = Matrix4x3f(Matrix4x4f::translate(offset) * Matrix4x4f::rotateX(angle * 16.0f) * Matrix4x4f::rotateY(angle * 24.0f) * Matrix4x4f::rotateZ(angle * 32.0f));
+				}
+			}
+			command.setStorageData(0, transforms.get(), sizeof(Matrix4x3f) * transforms.size());
+			
 			// update Vulkan command
 			command.update();
 			
+			// begin timestamp
+			if(query_pool) vkCmdWriteTimestamp(command.getVKCommand(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, query_index);
+			
 			// draw model with Vulkan API
 			for(uint32_t i = 0; i < model.getNumGeometries(); i++) {
 				uint32_t num_indices = model.getNumGeometryIndices(i);
 				uint32_t base_index = model.getGeometryBaseIndex(i);
 				uint32_t base_vertex = model.getGeometryBaseVertex(i);
-				vkCmdDrawIndexed(command.getVKCommand(), num_indices, 1, base_index, base_vertex, 0);
+				vkCmdDrawIndexed(command.getVKCommand(), num_indices, num_instances, base_index, base_vertex, 0);
+			}
+			
+			// end timestamp
+			if(query_pool) {
+				vkCmdWriteTimestamp(command.getVKCommand(), VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, query_index + 1);
+				query_written[query_slot] = true;
 			}
 		}
 		target.end();
@@ -152,5 +230,8 @@ int32_t main(int32_t argc, char **argv) {
 	// finish context
 	window.finish();
 	
+	// destroy timestamp queries
+	if(query_pool) vkDestroyQueryPool(vk_device.getVKDevice(), query_pool, nullptr);
+	
 	return 0;
 }